@@ -0,0 +1,110 @@
+#!/bin/bash
+# bench.sh - chperm throughput benchmark harness
+#
+# Generates a parameterized synthetic tree and runs chperm over it in its
+# various modes, reporting files/sec, syscalls/file (when strace is
+# available), and peak RSS (when /usr/bin/time is available).  Used by
+# "make bench" to catch throughput regressions before an upgrade reaches
+# the fileservers.
+#
+# Tunables (environment variables):
+#   BENCH_DEPTH    directory depth                (default 4)
+#   BENCH_FANOUT   subdirectories per directory   (default 4)
+#   BENCH_FILES    files per directory            (default 16)
+#   BENCH_SYMLINKS symlinks per directory         (default 1)
+#   BENCH_THREADS  thread counts to try           (default "1 4")
+#   BENCH_DIR      scratch directory              (default ./bench_tree)
+
+set -u
+
+CHPERM=${CHPERM:-./chperm}
+BENCH_DEPTH=${BENCH_DEPTH:-4}
+BENCH_FANOUT=${BENCH_FANOUT:-4}
+BENCH_FILES=${BENCH_FILES:-16}
+BENCH_SYMLINKS=${BENCH_SYMLINKS:-1}
+BENCH_THREADS=${BENCH_THREADS:-"1 4"}
+BENCH_DIR=${BENCH_DIR:-./bench_tree}
+
+OWNER=$(id -un)
+GROUP=$(id -gn)
+
+if [ ! -x "$CHPERM" ]; then
+    echo "bench.sh: $CHPERM not built (run make first)" >&2
+    exit 1
+fi
+
+# --- synthetic tree generator ------------------------------------------------
+
+gen_level() {
+    # gen_level <dir> <remaining-depth>
+    local dir=$1 depth=$2 i
+    for i in $(seq 1 "$BENCH_FILES"); do
+        : > "$dir/file$i"
+    done
+    for i in $(seq 1 "$BENCH_SYMLINKS"); do
+        ln -s "file$i" "$dir/link$i" 2>/dev/null
+    done
+    if [ "$depth" -gt 0 ]; then
+        for i in $(seq 1 "$BENCH_FANOUT"); do
+            mkdir "$dir/dir$i"
+            gen_level "$dir/dir$i" $((depth - 1))
+        done
+    fi
+}
+
+echo "Generating tree: depth=$BENCH_DEPTH fanout=$BENCH_FANOUT files/dir=$BENCH_FILES symlinks/dir=$BENCH_SYMLINKS"
+rm -rf "$BENCH_DIR"
+mkdir -p "$BENCH_DIR"
+gen_level "$BENCH_DIR" "$BENCH_DEPTH"
+NFILES=$(find "$BENCH_DIR" | wc -l)
+echo "Tree ready: $NFILES entries"
+echo
+
+# --- measurement helpers -----------------------------------------------------
+
+HAVE_STRACE=
+command -v strace >/dev/null 2>&1 && HAVE_STRACE=1
+HAVE_TIME=
+[ -x /usr/bin/time ] && HAVE_TIME=1
+
+run_case() {
+    # run_case <label> <chperm args...>
+    local label=$1; shift
+    local start end elapsed_ms fps rss syscalls
+
+    start=$(date +%s%N)
+    "$CHPERM" "$@" >/dev/null 2>&1
+    end=$(date +%s%N)
+    elapsed_ms=$(( (end - start) / 1000000 ))
+    [ "$elapsed_ms" -eq 0 ] && elapsed_ms=1
+    fps=$(( NFILES * 1000 / elapsed_ms ))
+
+    rss="n/a"
+    if [ -n "$HAVE_TIME" ]; then
+        rss=$(/usr/bin/time -f '%M' "$CHPERM" "$@" 2>&1 >/dev/null | tail -1)
+        rss="${rss}KB"
+    fi
+
+    syscalls="n/a"
+    if [ -n "$HAVE_STRACE" ]; then
+        local total
+        total=$(strace -f -c -U calls "$CHPERM" "$@" 2>&1 >/dev/null \
+                | awk '/^[0-9]+ total/ {print $1}')
+        [ -n "$total" ] && syscalls=$(( total / NFILES ))
+    fi
+
+    printf '%-28s %8s ms %10s files/s %8s syscalls/file %10s peak RSS\n' \
+           "$label" "$elapsed_ms" "$fps" "$syscalls" "$rss"
+}
+
+# --- benchmark matrix --------------------------------------------------------
+
+for j in $BENCH_THREADS; do
+    run_case "numeric -R -j$j"          -R -j "$j" "$OWNER:$GROUP" 755 "$BENCH_DIR"
+    run_case "numeric -R -j$j -v"       -R -j "$j" -v "$OWNER:$GROUP" 755 "$BENCH_DIR"
+    run_case "symbolic -R -j$j"         -R -j "$j" "$OWNER:$GROUP" u+rw,g+r "$BENCH_DIR"
+    run_case "if-needed -R -j$j"        -R -j "$j" --if-needed "$OWNER:$GROUP" 755 "$BENCH_DIR"
+    run_case "io_uring -R -j$j"         -R -j "$j" --io-uring "$OWNER:$GROUP" 755 "$BENCH_DIR"
+done
+
+rm -rf "$BENCH_DIR"
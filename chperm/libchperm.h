@@ -0,0 +1,71 @@
+/* libchperm.h - embeddable API for in-process ownership/permission fixups
+ *
+ * The other tools in this repo used to shell out to chperm per fixup,
+ * paying a fork/exec and losing the warm uid/gid caches every time.
+ * Linking libchperm instead makes a fixup an ordinary function call: a
+ * context carries a parsed owner/mode spec (parsed once, like the CLI
+ * does per invocation) and chperm_apply() runs the same apply/traversal
+ * core the command-line tool uses, including the threaded engine for
+ * recursive calls.
+ *
+ *   chperm_ctx *ctx = chperm_ctx_new();
+ *   chperm_ctx_set_owner(ctx, "svc:svc");
+ *   chperm_ctx_set_mode(ctx, "u+rwX,go-w");
+ *   chperm_apply(ctx, "/srv/foo", CHPERM_RECURSIVE | CHPERM_IF_NEEDED);
+ *   chperm_ctx_free(ctx);
+ *
+ * Applies are serialized internally (the core keeps some per-invocation
+ * state in globals, as the daemon mode does), so concurrent callers on
+ * different contexts are safe but run one at a time.  Build the library
+ * with "make lib" (libchperm.a and libchperm.so).
+ */
+
+#ifndef LIBCHPERM_H
+#define LIBCHPERM_H
+
+#include <sys/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+typedef struct chperm_ctx chperm_ctx;
+
+/* chperm_apply() flags */
+#define CHPERM_RECURSIVE  (1u << 0)  /* descend into directories (-R) */
+#define CHPERM_IF_NEEDED  (1u << 1)  /* skip syscalls when metadata matches */
+#define CHPERM_NO_DEREF   (1u << 2)  /* affect symlinks themselves (-h) */
+
+/* Called once per entry whose ownership or permissions were changed */
+typedef void (*chperm_change_fn)(const char *path,
+                                 uid_t old_uid, gid_t old_gid,
+                                 uid_t new_uid, gid_t new_gid,
+                                 mode_t old_mode, mode_t new_mode,
+                                 void *arg);
+
+/* Context lifecycle.  A fresh context changes nothing until an owner
+ * and/or mode is set on it. */
+chperm_ctx *chperm_ctx_new(void);
+void chperm_ctx_free(chperm_ctx *ctx);
+
+/* "user", ":group", "user:group", or numeric ids; 0 on success */
+int chperm_ctx_set_owner(chperm_ctx *ctx, const char *spec);
+
+/* Numeric ("644") or symbolic ("u+rwX,go-w") mode; 0 on success */
+int chperm_ctx_set_mode(chperm_ctx *ctx, const char *mode);
+
+/* Worker threads for recursive applies (default 1) */
+void chperm_ctx_set_threads(chperm_ctx *ctx, int threads);
+
+/* Report each applied change; pass NULL to clear */
+void chperm_ctx_on_change(chperm_ctx *ctx, chperm_change_fn fn, void *arg);
+
+/* Apply the context's spec to path; 0 on success, -1 if anything failed
+ * (the sweep still visits everything it can, like the CLI) */
+int chperm_apply(chperm_ctx *ctx, const char *path, unsigned flags);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* LIBCHPERM_H */